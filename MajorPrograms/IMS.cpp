@@ -1,9 +1,25 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <algorithm>
 #include <iomanip> // For std::setprecision
+#include <unordered_map>
+#include <set>
+#include <functional>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <charconv>
+#include <cstring>
+#include <cmath>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -13,23 +29,890 @@ public:
     string name;
     int quantity;
     double price;
+    int reorderPoint = -1; // Low when quantity drops below this; -1 uses the inventory default
 
     Item(string name, int quantity, double price)
-        : name(name), quantity(quantity), price(price) {}
+        : name(std::move(name)), quantity(quantity), price(price) {}
 
     void display() const {
         cout << "Name: " << name << ", Quantity: " << quantity << ", Price: $" << fixed << setprecision(2) << price << endl;
     }
 };
 
+// Read-only memory mapping of a whole file
+class MappedFile {
+    void* address = MAP_FAILED;
+    size_t length = 0;
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (address != MAP_FAILED) {
+            munmap(address, length);
+        }
+    }
+
+    // An empty file opens successfully with no data
+    bool open(const string& filename) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        bool ok = fstat(fd, &info) == 0;
+        if (ok && info.st_size > 0) {
+            length = static_cast<size_t>(info.st_size);
+            address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            ok = address != MAP_FAILED;
+            if (ok) {
+                madvise(address, length, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+        return ok;
+    }
+
+    const char* data() const { return address == MAP_FAILED ? nullptr : static_cast<const char*>(address); }
+    size_t size() const { return length; }
+};
+
+// CSV files follow RFC 4180: one name,quantity,price record per line, with a
+// field quoted when it holds a comma, quote or line break and quotes inside
+// it doubled. Lines may end in CRLF, and extra fields after price are ignored.
+void appendCsvRecord(string& out, const Item& item) {
+    if (item.name.find_first_of(",\"\r\n") == string::npos) {
+        out += item.name;
+    } else {
+        out += '"';
+        for (char c : item.name) {
+            if (c == '"') {
+                out += '"';
+            }
+            out += c;
+        }
+        out += '"';
+    }
+    char buffer[32];
+    out += ',';
+    out.append(buffer, to_chars(buffer, buffer + sizeof(buffer), item.quantity).ptr);
+    out += ',';
+    out.append(buffer, to_chars(buffer, buffer + sizeof(buffer), item.price).ptr);
+    out += '\n';
+}
+
+// Reads the field at p and returns the position after it and its delimiter;
+// atEnd is set when the field was the last of its record. An unquoted field is
+// viewed in place, a quoted one is unescaped into scratch and viewed there.
+const char* readCsvField(const char* p, const char* end, string& scratch, string_view& field, bool& atEnd) {
+    if (p < end && *p == '"') {
+        scratch.clear();
+        ++p;
+        while (p < end) {
+            const char* quote = static_cast<const char*>(memchr(p, '"', end - p));
+            if (!quote) {
+                scratch.append(p, end);
+                p = end;
+                break;
+            }
+            scratch.append(p, quote);
+            p = quote + 1;
+            if (p == end || *p != '"') {
+                break;
+            }
+            scratch += '"';
+            ++p;
+        }
+        // Anything between the closing quote and the delimiter is dropped
+        while (p < end && *p != ',' && *p != '\n') {
+            ++p;
+        }
+        field = scratch;
+    } else {
+        const char* start = p;
+        while (p < end && *p != ',' && *p != '\n') {
+            ++p;
+        }
+        const char* last = p;
+        if (last > start && last[-1] == '\r') {
+            --last;
+        }
+        field = string_view(start, last - start);
+    }
+    atEnd = p == end || *p == '\n';
+    return p < end ? p + 1 : p;
+}
+
+template <typename T>
+bool parseCsvNumber(string_view field, T& value) {
+    const char* first = field.data();
+    const char* last = first + field.size();
+    while (first < last && *first == ' ') {
+        ++first;
+    }
+    while (last > first && last[-1] == ' ') {
+        --last;
+    }
+    auto result = from_chars(first, last, value);
+    if (result.ec != errc() || result.ptr != last || first == last) {
+        return false;
+    }
+    if constexpr (is_floating_point_v<T>) {
+        return isfinite(value); // from_chars also takes "nan", "inf" and "infinity"
+    }
+    return true;
+}
+
+// Whether a record is the name,quantity,price header, in any case and spacing
+bool isCsvHeader(string_view name, string_view quantity, string_view price) {
+    auto matches = [](string_view field, string_view expected) {
+        size_t first = field.find_first_not_of(' ');
+        size_t last = field.find_last_not_of(' ');
+        field = first == string_view::npos ? string_view() : field.substr(first, last - first + 1);
+        return field.size() == expected.size()
+            && equal(field.begin(), field.end(), expected.begin(), [](char a, char b) { return tolower(a) == b; });
+    };
+    return matches(name, "name") && matches(quantity, "quantity") && matches(price, "price");
+}
+
+// A piece of a CSV file that starts at a record boundary, and what parsing it found
+struct CsvChunk {
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    vector<Item> items;
+    size_t malformed = 0;
+    bool atFileStart = false; // Only the file's first record may be a header
+};
+
+void parseCsvChunk(CsvChunk& chunk) {
+    string scratch[4];
+    string_view name, quantityField, priceField, extra;
+    const char* p = chunk.begin;
+    bool first = true;
+    while (p < chunk.end) {
+        if (*p == '\n' || (*p == '\r' && p + 1 < chunk.end && p[1] == '\n')) {
+            p += *p == '\n' ? 1 : 2; // Blank line
+            continue;
+        }
+        bool atEnd = false;
+        int fields = 0;
+        p = readCsvField(p, chunk.end, scratch[0], name, atEnd);
+        ++fields;
+        if (!atEnd) {
+            p = readCsvField(p, chunk.end, scratch[1], quantityField, atEnd);
+            ++fields;
+        }
+        if (!atEnd) {
+            p = readCsvField(p, chunk.end, scratch[2], priceField, atEnd);
+            ++fields;
+        }
+        while (!atEnd) {
+            p = readCsvField(p, chunk.end, scratch[3], extra, atEnd);
+        }
+        int quantity;
+        double price;
+        if (fields == 3 && parseCsvNumber(quantityField, quantity) && parseCsvNumber(priceField, price)) {
+            chunk.items.emplace_back(string(name), quantity, price);
+        } else if (!(first && chunk.atFileStart && fields == 3 && isCsvHeader(name, quantityField, priceField))) {
+            ++chunk.malformed;
+        }
+        first = false;
+    }
+}
+
+// Where a scan for record boundaries is: at the start of a field, in an
+// unquoted field or the junk after a quoted one, inside quotes, or just after a
+// quote inside quotes, which either closes the field or escapes a quote. These
+// are the cases readCsvField tells apart, so a quote only opens quotes at the
+// start of a field, as it does there.
+enum CsvScanState : uint8_t { FIELD_START, UNQUOTED, QUOTED, QUOTE_IN_QUOTED };
+
+CsvScanState stepCsvScan(CsvScanState state, char c) {
+    switch (state) {
+    case FIELD_START:
+        if (c == '"') {
+            return QUOTED;
+        }
+        break;
+    case QUOTED:
+        return c == '"' ? QUOTE_IN_QUOTED : QUOTED;
+    case QUOTE_IN_QUOTED:
+        if (c == '"') {
+            return QUOTED;
+        }
+        break;
+    case UNQUOTED:
+        break;
+    }
+    return c == ',' || c == '\n' ? FIELD_START : UNQUOTED;
+}
+
+// Steps four scans at once, one from each state: a byte holds each scan's
+// state in two bits, and the table maps a character and such a byte to the
+// next one
+const uint8_t* csvScanTable() {
+    static const vector<uint8_t> table = [] {
+        vector<uint8_t> table(256 * 256);
+        for (int c = 0; c < 256; ++c) {
+            for (int states = 0; states < 256; ++states) {
+                uint8_t next = 0;
+                for (int k = 0; k < 4; ++k) {
+                    next |= stepCsvScan(static_cast<CsvScanState>((states >> (2 * k)) & 3), static_cast<char>(c))
+                            << (2 * k);
+                }
+                table[c * 256 + states] = next;
+            }
+        }
+        return table;
+    }();
+    return table.data();
+}
+
+// Cuts data into up to pieceCount chunks that start at record boundaries. A
+// newline only ends a record outside quotes, and a piece cannot know whether it
+// starts inside quotes, so the pieces are scanned in parallel from all four
+// states at once. The state at each cut then follows from the one before it,
+// and only the short scans to the next boundary are sequential.
+vector<CsvChunk> splitCsv(const char* data, size_t size, unsigned pieceCount) {
+    const uint8_t startStates = 0xE4; // Scan k starts in state k
+    vector<uint8_t> endStates(pieceCount, startStates);
+    auto scanPiece = [&](unsigned i) {
+        const uint8_t* table = csvScanTable();
+        const char* p = data + size / pieceCount * i;
+        const char* end = data + size / pieceCount * (i + 1);
+        uint8_t states = startStates;
+        for (; p < end; ++p) {
+            states = table[static_cast<uint8_t>(*p) * 256 + states];
+        }
+        endStates[i] = states;
+    };
+    vector<thread> threads;
+    for (unsigned i = 1; i + 1 < pieceCount; ++i) {
+        threads.emplace_back(scanPiece, i);
+    }
+    if (pieceCount > 1) {
+        scanPiece(0);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    vector<CsvChunk> chunks(pieceCount);
+    chunks[0].atFileStart = true;
+    size_t begin = 0;
+    CsvScanState atCut = FIELD_START;
+    for (unsigned i = 0; i < pieceCount; ++i) {
+        size_t end = size;
+        if (i + 1 < pieceCount) {
+            atCut = static_cast<CsvScanState>((endStates[i] >> (2 * atCut)) & 3);
+            size_t cut = size / pieceCount * (i + 1);
+            CsvScanState state = atCut;
+            while (cut < size) {
+                bool quoted = state == QUOTED;
+                state = stepCsvScan(state, data[cut]);
+                if (data[cut++] == '\n' && !quoted) {
+                    break;
+                }
+            }
+            end = max(begin, cut);
+        }
+        chunks[i].begin = data + begin;
+        chunks[i].end = data + end;
+        begin = end;
+    }
+    return chunks;
+}
+
+// Binary snapshot layout, written by Save and read by Load. A header is followed
+// by one region per column, each 8-byte aligned so it can be used in place once
+// the file is mapped:
+//   nameEnds:      itemCount u64 offsets into the name heap where each name ends
+//   prices:        itemCount doubles
+//   quantities:    itemCount i32, zero padded to 8 bytes
+//   reorderPoints: itemCount i32, zero padded to 8 bytes
+//   names:         the names back to back, zero padded to 8 bytes
+// The checksum covers everything after the header.
+const char INVENTORY_MAGIC[8] = {'I', 'M', 'S', 'S', 'N', 'A', 'P', '\0'};
+const uint32_t INVENTORY_VERSION = 1;
+
+struct InventoryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t itemCount;
+    int64_t defaultReorderPoint;
+    uint64_t nameEndOffset;
+    uint64_t priceOffset;
+    uint64_t quantityOffset;
+    uint64_t reorderPointOffset;
+    uint64_t nameOffset;
+    uint64_t nameSize; // Including padding
+    uint64_t checksum;
+};
+
+static_assert(sizeof(InventoryHeader) % 8 == 0, "snapshot regions must keep 8-byte alignment");
+
+// Word-at-a-time hash; size must be a multiple of 8
+uint64_t snapshotChecksum(const char* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    for (size_t i = 0; i < size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 1099511628211ull;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+// Read access to a snapshot straight from its mapping. open checks the layout
+// and checksum once; after that every column is read in place.
+class InventorySnapshot {
+    MappedFile file;
+    InventoryHeader header{};
+    const uint64_t* nameEnds = nullptr;
+    const double* prices = nullptr;
+    const int32_t* quantities = nullptr;
+    const int32_t* reorderPoints = nullptr;
+    const char* names = nullptr;
+
+    static uint64_t padded(uint64_t size) {
+        return (size + 7) & ~uint64_t(7);
+    }
+
+public:
+    // Returns false with a reason in error if the file is missing, not a
+    // snapshot or damaged
+    bool open(const string& filename, string& error) {
+        if (!file.open(filename)) {
+            error = "Unable to open file.";
+            return false;
+        }
+        const uint64_t size = file.size();
+        if (size < sizeof(header)) {
+            error = filename + " is not an inventory snapshot; use Import from CSV for text files.";
+            return false;
+        }
+        memcpy(&header, file.data(), sizeof(header));
+        const uint64_t count = header.itemCount;
+        bool valid = memcmp(header.magic, INVENTORY_MAGIC, sizeof(header.magic)) == 0;
+        if (!valid) {
+            error = filename + " is not an inventory snapshot; use Import from CSV for text files.";
+            return false;
+        }
+        // Each column must start where the previous one ends and end inside the
+        // file. Every end is checked against size before it is used, and count is
+        // bounded first, so no sum below can wrap around.
+        uint64_t end = sizeof(header);
+        auto column = [&](uint64_t offset, uint64_t bytes) {
+            if (offset != end || bytes > size - end) {
+                return false;
+            }
+            end += bytes;
+            return true;
+        };
+        valid = header.version == INVENTORY_VERSION && header.headerSize == sizeof(header)
+            && count <= size / sizeof(uint64_t)
+            && column(header.nameEndOffset, count * sizeof(uint64_t))
+            && column(header.priceOffset, count * sizeof(double))
+            && column(header.quantityOffset, padded(count * sizeof(int32_t)))
+            && column(header.reorderPointOffset, padded(count * sizeof(int32_t)))
+            && header.nameSize % 8 == 0
+            && header.nameOffset <= size && header.nameSize == size - header.nameOffset
+            && column(header.nameOffset, header.nameSize);
+        if (!valid) {
+            error = filename + " is not a valid inventory snapshot.";
+            return false;
+        }
+        if (snapshotChecksum(file.data() + sizeof(header), size - sizeof(header)) != header.checksum) {
+            error = filename + " failed its checksum.";
+            return false;
+        }
+        nameEnds = reinterpret_cast<const uint64_t*>(file.data() + header.nameEndOffset);
+        prices = reinterpret_cast<const double*>(file.data() + header.priceOffset);
+        quantities = reinterpret_cast<const int32_t*>(file.data() + header.quantityOffset);
+        reorderPoints = reinterpret_cast<const int32_t*>(file.data() + header.reorderPointOffset);
+        names = file.data() + header.nameOffset;
+        for (uint64_t i = 0, previous = 0; i < count; previous = nameEnds[i++]) {
+            if (nameEnds[i] < previous || nameEnds[i] > header.nameSize) {
+                error = filename + " is not a valid inventory snapshot.";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t size() const { return header.itemCount; }
+    int defaultReorderPoint() const { return static_cast<int>(header.defaultReorderPoint); }
+
+    string_view name(size_t i) const {
+        uint64_t begin = i == 0 ? 0 : nameEnds[i - 1];
+        return string_view(names + begin, nameEnds[i] - begin);
+    }
+    int quantity(size_t i) const { return quantities[i]; }
+    double price(size_t i) const { return prices[i]; }
+    int reorderPoint(size_t i) const { return reorderPoints[i]; }
+};
+
+// Writes all of the buffers, continuing after partial writes
+bool writeFully(int fd, iovec* parts, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, parts, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        size_t left = static_cast<size_t>(written);
+        while (count > 0 && left >= parts->iov_len) {
+            left -= parts->iov_len;
+            ++parts;
+            --count;
+        }
+        if (count > 0) {
+            parts->iov_base = static_cast<char*>(parts->iov_base) + left;
+            parts->iov_len -= left;
+        }
+    }
+    return true;
+}
+
+// fsyncs the directory holding filename, so that a rename into it is durable
+bool syncParentDirectory(const string& filename) {
+    size_t slash = filename.rfind('/');
+    string directory = slash == string::npos ? "." : slash == 0 ? "/" : filename.substr(0, slash);
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+// What an import did with the records it read
+struct ImportResult {
+    size_t added = 0;
+    size_t updated = 0;
+    size_t duplicates = 0; // Names already in the inventory, when not upserting
+    size_t malformed = 0;
+    size_t wentLow = 0; // Items the import left below their reorder point
+};
+
 // Class to manage the Inventory
 class Inventory {
 private:
     vector<Item> items;
+    // Item name -> position in items. Names are unique, so every lookup by name
+    // is one hash probe; anything that moves items must keep this in step.
+    unordered_map<string, size_t> index;
+    // (price, name) for every item, cheapest first. Unlike the items vector it is
+    // never re-sorted, so price order is available whatever order items are in.
+    // NaN would break its ordering, so only finite prices get in (validPrice).
+    set<pair<double, string>> byPrice;
+    // Names of items whose quantity is below their reorder point. Every stock
+    // change moves an item in or out, so the watchlist never needs a scan.
+    set<string> lowStock;
+    int defaultReorderPoint = -1; // -1: items without their own reorder point are never low
+    function<void(const Item&, bool)> lowStockListener;
+    bool bulkChange = false;  // While set, crossings are counted instead of sent to the listener
+    size_t bulkWentLow = 0;   // Items that went low during bulk changes, ever
+
+    int reorderPointOf(const Item& item) const {
+        return item.reorderPoint >= 0 ? item.reorderPoint : defaultReorderPoint;
+    }
+
+    // Moves item in or out of the watchlist after its quantity or reorder point
+    // changed, and tells the listener when it crossed over
+    void updateWatchlist(const Item& item, bool wasLow) {
+        bool isLow = item.quantity < reorderPointOf(item);
+        if (isLow == wasLow) {
+            return;
+        }
+        if (isLow) {
+            lowStock.insert(item.name);
+        } else {
+            lowStock.erase(item.name);
+        }
+        if (bulkChange) {
+            bulkWentLow += isLow;
+        } else if (lowStockListener) {
+            lowStockListener(item, isLow);
+        }
+    }
+
+    // Runs change with the listener held back, so a bulk change reports one
+    // count rather than a notification per item. Returns how many items the
+    // change left newly below their reorder point.
+    template <typename Change>
+    size_t asBulkChange(Change change) {
+        bool outer = bulkChange;
+        size_t before = bulkWentLow;
+        bulkChange = true;
+        change();
+        bulkChange = outer;
+        return bulkWentLow - before;
+    }
+
+    void setQuantity(Item& item, int quantity) {
+        bool wasLow = item.quantity < reorderPointOf(item);
+        item.quantity = quantity;
+        updateWatchlist(item, wasLow);
+    }
+
+    Item* findItem(const string& itemName) {
+        auto found = index.find(itemName);
+        return found == index.end() ? nullptr : &items[found->second];
+    }
+
+    const Item* findItem(const string& itemName) const {
+        return const_cast<Inventory*>(this)->findItem(itemName);
+    }
+
+    void rebuildIndex() {
+        index.clear();
+        index.reserve(items.size());
+        for (size_t i = 0; i < items.size(); ++i) {
+            index[items[i].name] = i;
+        }
+    }
+
+    static bool validPrice(double price) {
+        return isfinite(price);
+    }
+
+    // Moves item in unless its name is taken, in which case item is left as it
+    // was. Either way returns the position of the item with that name. Callers
+    // check the price with validPrice first.
+    size_t insertItem(Item&& item, bool& inserted) {
+        auto slot = index.try_emplace(item.name, items.size());
+        inserted = slot.second;
+        if (inserted) {
+            byPrice.emplace(item.price, item.name);
+            items.push_back(std::move(item));
+            updateWatchlist(items.back(), false);
+        }
+        return slot.first->second;
+    }
+
+    bool insertItem(Item&& item) {
+        bool inserted;
+        insertItem(std::move(item), inserted);
+        return inserted;
+    }
+
+    bool setPrice(Item& item, double price) {
+        if (!validPrice(price)) {
+            return false;
+        }
+        if (item.price != price) {
+            byPrice.erase({item.price, item.name});
+            byPrice.emplace(price, item.name);
+            item.price = price;
+        }
+        return true;
+    }
+
+    // Prints what readCsv did, leaving out the counts that are zero
+    static void reportImport(const ImportResult& result) {
+        cout << "Added " << result.added << " items";
+        if (result.updated > 0) {
+            cout << ", updated " << result.updated;
+        }
+        cout << "." << endl;
+        if (result.duplicates > 0) {
+            cout << "Skipped " << result.duplicates << " items whose names were already in the inventory." << endl;
+        }
+        if (result.malformed > 0) {
+            cout << "Skipped " << result.malformed << " malformed lines." << endl;
+        }
+        if (result.wentLow > 0) {
+            cout << result.wentLow << " items are now below their reorder point." << endl;
+        }
+    }
+
+    // Applies parsed CSV records in file order for readCsv
+    void mergeChunks(vector<CsvChunk>& chunks, bool upsert, ImportResult& result) {
+        for (size_t c = 0; c < chunks.size(); ++c) {
+            CsvChunk& chunk = chunks[c];
+            result.malformed += chunk.malformed;
+            for (Item& item : chunk.items) {
+                if (!validPrice(item.price)) {
+                    ++result.malformed;
+                    continue;
+                }
+                bool inserted;
+                size_t pos = insertItem(std::move(item), inserted);
+                if (inserted) {
+                    ++result.added;
+                } else if (upsert) {
+                    Item& existing = items[pos];
+                    setQuantity(existing, item.quantity);
+                    setPrice(existing, item.price);
+                    ++result.updated;
+                } else {
+                    ++result.duplicates;
+                }
+            }
+            vector<Item>().swap(chunk.items); // Release moved-from items as we go
+        }
+    }
+
+    // Adds the items of a mapped snapshot for readSnapshot
+    void addSnapshotItems(const InventorySnapshot& snapshot, ImportResult& result) {
+        index.reserve(items.size() + snapshot.size());
+        items.reserve(items.size() + snapshot.size());
+        for (size_t i = 0; i < snapshot.size(); ++i) {
+            Item item(string(snapshot.name(i)), snapshot.quantity(i), snapshot.price(i));
+            item.reorderPoint = snapshot.reorderPoint(i);
+            if (!validPrice(item.price)) {
+                ++result.malformed;
+            } else if (insertItem(std::move(item))) {
+                ++result.added;
+            } else {
+                ++result.duplicates;
+            }
+        }
+    }
 
 public:
-    void addItem(const Item& item) {
-        items.push_back(item);
+    // Adds an item unless one with the same name exists; returns whether it was added
+    bool addItem(const Item& item) {
+        if (!validPrice(item.price)) {
+            cout << "Invalid price for \"" << item.name << "\"." << endl;
+            return false;
+        }
+        if (!insertItem(Item(item))) {
+            cout << "Item \"" << item.name << "\" already exists." << endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Adds additionalQuantity to an item without console output; returns false
+    // if there is no such item
+    bool restock(const string& itemName, int additionalQuantity) {
+        Item* item = findItem(itemName);
+        if (!item) {
+            return false;
+        }
+        setQuantity(*item, item->quantity + additionalQuantity);
+        return true;
+    }
+
+    // Takes quantity units out of stock without console output; returns false,
+    // changing nothing, if the item is missing or has fewer units than that
+    bool decrement(const string& itemName, int quantity) {
+        Item* item = findItem(itemName);
+        if (!item || quantity < 0 || item->quantity < quantity) {
+            return false;
+        }
+        setQuantity(*item, item->quantity - quantity);
+        return true;
+    }
+
+    void sellItem(const string& itemName, int quantity) {
+        const Item* item = findItem(itemName);
+        if (!item) {
+            cout << "Item \"" << itemName << "\" not found." << endl;
+        } else if (decrement(itemName, quantity)) {
+            cout << "Sold " << quantity << " units of \"" << itemName << "\"; " << item->quantity << " left." << endl;
+        } else {
+            cout << "Only " << item->quantity << " units of \"" << itemName << "\" in stock." << endl;
+        }
+    }
+
+    // Called with (item, true) when an item drops below its reorder point and
+    // (item, false) when it recovers, so a consumer need not poll the watchlist
+    void setLowStockListener(function<void(const Item&, bool)> listener) {
+        lowStockListener = std::move(listener);
+    }
+
+    // Sets one item's reorder point; -1 makes it follow the inventory default
+    bool setReorderPoint(const string& itemName, int reorderPoint) {
+        Item* item = findItem(itemName);
+        if (!item) {
+            return false;
+        }
+        bool wasLow = item->quantity < reorderPointOf(*item);
+        item->reorderPoint = reorderPoint;
+        updateWatchlist(*item, wasLow);
+        return true;
+    }
+
+    // Sets the reorder point of every item that has none of its own. This is
+    // the one watchlist operation that visits all items, so it notifies as a
+    // bulk change and returns how many items went low.
+    size_t setDefaultReorderPoint(int reorderPoint) {
+        return asBulkChange([&]() {
+            int previous = defaultReorderPoint;
+            defaultReorderPoint = reorderPoint;
+            for (const auto& item : items) {
+                if (item.reorderPoint < 0) {
+                    updateWatchlist(item, item.quantity < previous);
+                }
+            }
+        });
+    }
+
+    size_t lowStockCount() const {
+        return lowStock.size();
+    }
+
+    void displayLowStock() const {
+        cout << "Low-stock watchlist (" << lowStock.size() << " items):" << endl;
+        for (const auto& name : lowStock) {
+            const Item* item = findItem(name);
+            cout << "Reorder point " << reorderPointOf(*item) << " - ";
+            item->display();
+        }
+    }
+
+    size_t itemCount() const {
+        return items.size();
+    }
+
+    // addItem without the duplicate message
+    bool insertQuietly(Item item) {
+        return insertItem(std::move(item));
+    }
+
+    // Reads a CSV file (see appendCsvRecord) without console output. The file is
+    // mapped and its chunks parsed on threadCount threads (0: one per core), then
+    // the records are applied in file order. A name already in the inventory is
+    // skipped, or with upsert its quantity and price are overwritten. A first
+    // line of name,quantity,price is skipped as a header; any other line that
+    // does not parse, or has a non-finite number, is counted as malformed.
+    // Returns false if the file could not be read.
+    bool readCsv(const string& filename, bool upsert, ImportResult& result, unsigned threadCount = 0) {
+        MappedFile file;
+        if (!file.open(filename)) {
+            return false;
+        }
+        // Small files are not worth a thread each
+        size_t maxPieces = max<size_t>(1, file.size() / (1 << 20));
+        unsigned pieceCount = static_cast<unsigned>(
+            min<size_t>(maxPieces, max(1u, threadCount ? threadCount : thread::hardware_concurrency())));
+        vector<CsvChunk> chunks = splitCsv(file.data(), file.size(), pieceCount);
+        vector<thread> threads;
+        for (unsigned i = 1; i < pieceCount; ++i) {
+            threads.emplace_back(parseCsvChunk, ref(chunks[i]));
+        }
+        parseCsvChunk(chunks[0]);
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        size_t total = 0;
+        for (const auto& chunk : chunks) {
+            total += chunk.items.size();
+        }
+        index.reserve(items.size() + total);
+        items.reserve(items.size() + total);
+        result.wentLow += asBulkChange([&]() { mergeChunks(chunks, upsert, result); });
+        return true;
+    }
+
+    // Writes a binary snapshot without console output. The columns are built in
+    // memory and go out in one vectored write to a temporary file, which is
+    // synced and renamed over filename; the directory is synced after that.
+    bool writeSnapshot(const string& filename) const {
+        const size_t count = items.size();
+        const size_t paddedCount = count + count % 2; // i32 columns end on 8 bytes
+        vector<uint64_t> nameEnds(count);
+        vector<double> prices(count);
+        vector<int32_t> quantities(paddedCount, 0), reorderPoints(paddedCount, 0);
+        size_t nameBytes = 0;
+        for (size_t i = 0; i < count; ++i) {
+            nameBytes += items[i].name.size();
+            nameEnds[i] = nameBytes;
+            prices[i] = items[i].price;
+            quantities[i] = items[i].quantity;
+            reorderPoints[i] = items[i].reorderPoint;
+        }
+        string names;
+        names.reserve(nameBytes + 8);
+        for (const auto& item : items) {
+            names += item.name;
+        }
+        names.append((8 - names.size() % 8) % 8, '\0');
+
+        InventoryHeader header{};
+        memcpy(header.magic, INVENTORY_MAGIC, sizeof(header.magic));
+        header.version = INVENTORY_VERSION;
+        header.headerSize = sizeof(header);
+        header.itemCount = count;
+        header.defaultReorderPoint = defaultReorderPoint;
+        header.nameEndOffset = sizeof(header);
+        header.priceOffset = header.nameEndOffset + count * sizeof(uint64_t);
+        header.quantityOffset = header.priceOffset + count * sizeof(double);
+        header.reorderPointOffset = header.quantityOffset + paddedCount * sizeof(int32_t);
+        header.nameOffset = header.reorderPointOffset + paddedCount * sizeof(int32_t);
+        header.nameSize = names.size();
+        iovec parts[] = {
+            {&header, sizeof(header)},
+            {nameEnds.data(), count * sizeof(uint64_t)},
+            {prices.data(), count * sizeof(double)},
+            {quantities.data(), paddedCount * sizeof(int32_t)},
+            {reorderPoints.data(), paddedCount * sizeof(int32_t)},
+            {&names[0], names.size()},
+        };
+        uint64_t checksum = snapshotChecksum(nullptr, 0);
+        for (size_t i = 1; i < sizeof(parts) / sizeof(parts[0]); ++i) {
+            checksum = snapshotChecksum(static_cast<const char*>(parts[i].iov_base), parts[i].iov_len, checksum);
+        }
+        header.checksum = checksum;
+
+        string tempFile = filename + ".tmp";
+        int fd = ::open(tempFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = writeFully(fd, parts, sizeof(parts) / sizeof(parts[0])) && fdatasync(fd) == 0;
+        ok = ::close(fd) == 0 && ok;
+        if (!ok || rename(tempFile.c_str(), filename.c_str()) != 0) {
+            unlink(tempFile.c_str());
+            return false;
+        }
+        return syncParentDirectory(filename);
+    }
+
+    // Adds the items of a binary snapshot, skipping names already in the
+    // inventory. The snapshot's default reorder point is only taken into an
+    // empty inventory; merged into existing items, the current one stays.
+    // Returns false with a reason in error, changing nothing, if the snapshot
+    // cannot be used.
+    bool readSnapshot(const string& filename, ImportResult& result, string& error) {
+        InventorySnapshot snapshot;
+        if (!snapshot.open(filename, error)) {
+            return false;
+        }
+        result.wentLow += asBulkChange([&]() {
+            if (items.empty()) {
+                setDefaultReorderPoint(snapshot.defaultReorderPoint());
+            }
+            addSnapshotItems(snapshot, result);
+        });
+        return true;
+    }
+
+    // Writes every item as CSV without console output
+    bool writeCsv(const string& filename) const {
+        ofstream file(filename, ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+        string buffer;
+        for (const auto& item : items) {
+            appendCsvRecord(buffer, item);
+            if (buffer.size() >= (1 << 16)) {
+                file.write(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+        }
+        file.write(buffer.data(), buffer.size());
+        return static_cast<bool>(file.flush());
     }
 
     void displayItems() const {
@@ -43,78 +926,76 @@ public:
         }
     }
 
+    // Save and Load use the binary snapshot; CSV is only for export and import
     void saveToFile(const string& filename) const {
-        ofstream file(filename);
-        if (file.is_open()) {
-            for (const auto& item : items) {
-                file << item.name << "," << item.quantity << "," << item.price << endl;
-            }
-            file.close();
+        if (writeSnapshot(filename)) {
             cout << "Inventory saved to " << filename << endl;
         } else {
-            cout << "Unable to open file." << endl;
+            cout << "Unable to write " << filename << endl;
         }
     }
 
     void loadFromFile(const string& filename) {
-        ifstream file(filename);
-        if (file.is_open()) {
-            string name;
-            int quantity;
-            double price;
-            while (getline(file, name, ',')) {
-                file >> quantity;
-                file.ignore(); // Ignore the comma
-                file >> price;
-                file.ignore(); // Ignore the newline
-                items.emplace_back(name, quantity, price);
-            }
-            file.close();
+        ImportResult result;
+        string error;
+        if (readSnapshot(filename, result, error)) {
+            reportImport(result);
             cout << "Inventory loaded from " << filename << endl;
         } else {
-            cout << "Unable to open file." << endl;
+            cout << error << endl;
         }
     }
 
+    // Removes in O(1) by moving the last item into the hole, so the order of the
+    // remaining items changes; sort again for an ordered listing
     void removeItem(const string& itemName) {
-        auto it = remove_if(items.begin(), items.end(), [&](const Item& item) {
-            return item.name == itemName;
-        });
-        if (it != items.end()) {
-            items.erase(it, items.end());
-            cout << "Item \"" << itemName << "\" removed from inventory." << endl;
-        } else {
+        auto found = index.find(itemName);
+        if (found == index.end()) {
             cout << "Item \"" << itemName << "\" not found." << endl;
+            return;
+        }
+        size_t pos = found->second;
+        byPrice.erase({items[pos].price, itemName});
+        lowStock.erase(itemName);
+        index.erase(found);
+        if (pos + 1 != items.size()) {
+            items[pos] = std::move(items.back());
+            index[items[pos].name] = pos;
         }
+        items.pop_back();
+        cout << "Item \"" << itemName << "\" removed from inventory." << endl;
     }
 
     void updateItem(const string& itemName, int quantity, double price) {
-        for (auto& item : items) {
-            if (item.name == itemName) {
-                item.quantity = quantity;
-                item.price = price;
-                cout << "Item \"" << itemName << "\" updated." << endl;
-                return;
-            }
+        Item* item = findItem(itemName);
+        if (!item) {
+            cout << "Item \"" << itemName << "\" not found." << endl;
+            return;
+        }
+        if (!validPrice(price)) {
+            cout << "Invalid price for \"" << itemName << "\"." << endl;
+            return;
         }
-        cout << "Item \"" << itemName << "\" not found." << endl;
+        setQuantity(*item, quantity);
+        setPrice(*item, price);
+        cout << "Item \"" << itemName << "\" updated." << endl;
     }
 
     void searchItem(const string& itemName) const {
-        for (const auto& item : items) {
-            if (item.name == itemName) {
-                cout << "Found: ";
-                item.display();
-                return;
-            }
+        const Item* item = findItem(itemName);
+        if (!item) {
+            cout << "Item \"" << itemName << "\" not found." << endl;
+            return;
         }
-        cout << "Item \"" << itemName << "\" not found." << endl;
+        cout << "Found: ";
+        item->display();
     }
 
     void sortItems() {
         sort(items.begin(), items.end(), [](const Item& a, const Item& b) {
             return a.name < b.name;
         });
+        rebuildIndex();
         cout << "Inventory sorted by item name." << endl;
     }
 
@@ -131,14 +1012,11 @@ public:
     }
 
     void restockItem(const string& itemName, int additionalQuantity) {
-        for (auto& item : items) {
-            if (item.name == itemName) {
-                item.quantity += additionalQuantity;
-                cout << "Restocked \"" << itemName << "\" by " << additionalQuantity << " units." << endl;
-                return;
-            }
+        if (restock(itemName, additionalQuantity)) {
+            cout << "Restocked \"" << itemName << "\" by " << additionalQuantity << " units." << endl;
+        } else {
+            cout << "Item \"" << itemName << "\" not found." << endl;
         }
-        cout << "Item \"" << itemName << "\" not found." << endl;
     }
 
     void batchAddItems() {
@@ -169,32 +1047,18 @@ public:
     }
 
     void exportToCSV(const string& filename) const {
-        ofstream file(filename);
-        if (file.is_open()) {
-            for (const auto& item : items) {
-                file << item.name << "," << item.quantity << "," << item.price << endl;
-            }
-            file.close();
+        if (writeCsv(filename)) {
             cout << "Inventory exported to " << filename << endl;
         } else {
             cout << "Unable to open file." << endl;
         }
     }
 
-    void importFromCSV(const string& filename) {
-        ifstream file(filename);
-        if (file.is_open()) {
-            string name;
-            int quantity;
-            double price;
-            while (getline(file, name, ',')) {
-                file >> quantity;
-                file.ignore(); // Ignore the comma
-                file >> price;
-                file.ignore(); // Ignore the newline
-                items.emplace_back(name, quantity, price);
-            }
-            file.close();
+    // With upsert, items already in the inventory take the file's quantity and price
+    void importFromCSV(const string& filename, bool upsert) {
+        ImportResult result;
+        if (readCsv(filename, upsert, result)) {
+            reportImport(result);
             cout << "Inventory imported from " << filename << endl;
         } else {
             cout << "Unable to open file." << endl;
@@ -202,64 +1066,181 @@ public:
     }
 
     void checkItemAvailability(const string& itemName) const {
-        for (const auto& item : items) {
-            if (item.name == itemName) {
-                if (item.quantity > 0) {
-                    cout << "Item \"" << itemName << "\" is available with quantity: " << item.quantity << endl;
-                } else {
-                    cout << "Item \"" << itemName << "\" is out of stock." << endl;
-                }
-                return;
-            }
+        const Item* item = findItem(itemName);
+        if (!item) {
+            cout << "Item \"" << itemName << "\" not found." << endl;
+        } else if (item->quantity > 0) {
+            cout << "Item \"" << itemName << "\" is available with quantity: " << item->quantity << endl;
+        } else {
+            cout << "Item \"" << itemName << "\" is out of stock." << endl;
         }
-        cout << "Item \"" << itemName << "\" not found." << endl;
     }
 
     // New method to get the most expensive item
     void getMostExpensiveItem() const {
-        if (items.empty()) {
+        if (byPrice.empty()) {
             cout << "Inventory is empty." << endl;
             return;
         }
-        auto maxItem = max_element(items.begin(), items.end(), [](const Item& a, const Item& b) {
-            return a.price < b.price;
-        });
         cout << "Most expensive item: ";
-        maxItem->display();
+        findItem(byPrice.rbegin()->second)->display();
     }
 
     // New method to get the least expensive item
     void getLeastExpensiveItem() const {
-        if (items.empty()) {
+        if (byPrice.empty()) {
             cout << "Inventory is empty." << endl;
             return;
         }
-        auto minItem = min_element(items.begin(), items.end(), [](const Item& a, const Item& b) {
-            return a.price < b.price;
-        });
         cout << "Least expensive item: ";
-        minItem->display();
+        findItem(byPrice.begin()->second)->display();
     }
 
-    // New method to sort items by price
-    void sortItemsByPrice() {
-        sort(items.begin(), items.end(), [](const Item& a, const Item& b) {
-            return a.price < b.price;
-        });
-        cout << "Inventory sorted by item price." << endl;
+    // Lists items cheapest first from the price index; the items vector keeps
+    // its own order, so a name sort done earlier still holds
+    void displayItemsByPrice() const {
+        cout << "Inventory by price:" << endl;
+        for (const auto& entry : byPrice) {
+            findItem(entry.second)->display();
+        }
     }
 
     // New method to filter items by price range
     void filterItemsByPriceRange(double minPrice, double maxPrice) const {
+        if (isnan(minPrice) || isnan(maxPrice)) {
+            cout << "Invalid price range." << endl;
+            return;
+        }
         cout << "Items in the price range $" << minPrice << " to $" << maxPrice << ":" << endl;
-        for (const auto& item : items) {
-            if (item.price >= minPrice && item.price <= maxPrice) {
-                item.display();
-            }
+        for (auto it = byPrice.lower_bound({minPrice, string()}); it != byPrice.end() && it->first <= maxPrice; ++it) {
+            findItem(it->second)->display();
         }
     }
 };
 
+// Restocks random items of an itemCount-item catalog restockCount times and
+// reports the rate, to check that point operations do not depend on catalog size
+void runRestockBenchmark(size_t itemCount, size_t restockCount) {
+    Inventory inventory;
+    for (size_t i = 0; i < itemCount; ++i) {
+        inventory.addItem(Item("SKU" + to_string(i), 10, 1.0 + i % 1000));
+    }
+    mt19937_64 rng(42);
+    uniform_int_distribution<size_t> pick(0, itemCount - 1);
+    vector<string> names;
+    names.reserve(restockCount);
+    for (size_t i = 0; i < restockCount; ++i) {
+        names.push_back("SKU" + to_string(pick(rng)));
+    }
+    size_t restocked = 0;
+    auto start = chrono::steady_clock::now();
+    for (const string& name : names) {
+        restocked += inventory.restock(name, 5);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Restock: " << restocked << " of " << restockCount << " restocks on " << inventory.itemCount()
+         << " items in " << fixed << setprecision(3) << seconds << " s (" << setprecision(0) << restockCount / seconds
+         << " restocks/sec, " << setprecision(1) << seconds * 1e9 / restockCount << " ns each)" << endl;
+}
+
+// Writes an itemCount-item supplier feed with a header, some quoted names (a
+// few of them over two lines) and some unquoted ones with a stray quote, then times a fresh import and an
+// upsert of the same file on top of it. Last, it checks that a single-threaded
+// import gives the same inventory, so the cuts between threads do not matter.
+void runImportBenchmark(size_t itemCount, unsigned threadCount, const string& filename) {
+    {
+        ofstream out(filename, ios::binary);
+        string buffer = "name,quantity,price\r\n";
+        for (size_t i = 0; i < itemCount; ++i) {
+            string name = i % 100 == 0  ? "Gadget\nset " + to_string(i)
+                          : i % 10 == 0 ? "Widget, \"deluxe\" " + to_string(i)
+                                        : "SKU-" + to_string(i);
+            size_t start = buffer.size();
+            appendCsvRecord(buffer, Item(std::move(name), static_cast<int>(i % 500), 0.25 * (i % 40000)));
+            if (i % 1000 == 999) {
+                buffer.insert(start, "5\" screw "); // Does not open quotes
+            }
+            if (buffer.size() >= (1 << 16)) {
+                out.write(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+        }
+        out.write(buffer.data(), buffer.size());
+    }
+    struct stat info;
+    double megabytes = stat(filename.c_str(), &info) == 0 ? info.st_size / 1e6 : 0;
+    Inventory inventory;
+    for (bool upsert : {false, true}) {
+        ImportResult result;
+        auto start = chrono::steady_clock::now();
+        bool ok = inventory.readCsv(filename, upsert, result, threadCount);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << (upsert ? "Upsert: " : "Import: ") << (ok ? "" : "FAILED ") << result.added << " added, "
+             << result.updated << " updated, " << result.malformed << " malformed from " << fixed << setprecision(1)
+             << megabytes << " MB in " << setprecision(3) << seconds << " s (" << setprecision(0)
+             << megabytes / seconds << " MB/s)" << endl;
+    }
+
+    Inventory single;
+    ImportResult singleResult;
+    single.readCsv(filename, false, singleResult, 1);
+    string singleFile = filename + ".1", parallelFile = filename + ".n";
+    MappedFile singleCsv, parallelCsv;
+    bool same = single.writeCsv(singleFile) && inventory.writeCsv(parallelFile) && singleCsv.open(singleFile)
+                && parallelCsv.open(parallelFile) && singleCsv.size() == parallelCsv.size()
+                && (singleCsv.size() == 0 || memcmp(singleCsv.data(), parallelCsv.data(), singleCsv.size()) == 0);
+    cout << "Single-threaded import: " << singleResult.added << " added, " << singleResult.malformed << " malformed, "
+         << (same ? "same items" : "DIFFERENT items") << endl;
+    remove(singleFile.c_str());
+    remove(parallelFile.c_str());
+    remove(filename.c_str());
+}
+
+// Saves and loads an itemCount-item inventory as a snapshot and as CSV, and
+// times opening the snapshot for in-place reads
+void runSnapshotBenchmark(size_t itemCount, const string& filename) {
+    Inventory source;
+    for (size_t i = 0; i < itemCount; ++i) {
+        source.insertQuietly(Item("SKU-" + to_string(i), static_cast<int>(i % 500), 0.01 * (i % 100000)));
+    }
+    auto seconds = [](chrono::steady_clock::time_point start) {
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+    auto megabytes = [&]() {
+        struct stat info;
+        return stat(filename.c_str(), &info) == 0 ? info.st_size / 1e6 : 0.0;
+    };
+    cout << fixed;
+    for (bool snapshot : {true, false}) {
+        auto start = chrono::steady_clock::now();
+        bool saved = snapshot ? source.writeSnapshot(filename) : source.writeCsv(filename);
+        double saveSeconds = seconds(start);
+        Inventory loaded;
+        ImportResult result;
+        string error;
+        start = chrono::steady_clock::now();
+        bool ok = snapshot ? loaded.readSnapshot(filename, result, error) : loaded.readCsv(filename, false, result);
+        double loadSeconds = seconds(start);
+        cout << (snapshot ? "Snapshot: " : "CSV:      ") << setprecision(1) << megabytes() << " MB, save "
+             << setprecision(3) << saveSeconds << " s, load " << loadSeconds << " s"
+             << (saved && ok && result.added == itemCount ? "" : " (FAILED)") << endl;
+        if (snapshot) {
+            InventorySnapshot view;
+            start = chrono::steady_clock::now();
+            bool opened = view.open(filename, error);
+            double openSeconds = seconds(start);
+            double total = 0;
+            start = chrono::steady_clock::now();
+            for (size_t i = 0; opened && i < view.size(); ++i) {
+                total += view.price(i) * view.quantity(i);
+            }
+            cout << "Snapshot view: open and verify " << openSeconds << " s, value of all items $" << setprecision(2)
+                 << total << " read in place in " << setprecision(3) << seconds(start) << " s" << endl;
+        }
+    }
+    remove(filename.c_str());
+}
+
 // Function to display the menu and get user choice
 int displayMenu() {
     int choice;
@@ -281,8 +1262,11 @@ int displayMenu() {
     cout << "15. Check Item Availability" << endl;
     cout << "16. Get Most Expensive Item" << endl;
     cout << "17. Get Least Expensive Item" << endl;
-    cout << "18. Sort Items by Price" << endl;
+    cout << "18. List Items by Price" << endl;
     cout << "19. Filter Items by Price Range" << endl;
+    cout << "21. Sell Item" << endl;
+    cout << "22. Set Reorder Point" << endl;
+    cout << "23. Show Low-Stock Watchlist" << endl;
     cout << "20. Exit" << endl;
     cout << "Enter your choice: ";
     cin >> choice;
@@ -290,10 +1274,37 @@ int displayMenu() {
 }
 
 // Main function
-int main() {
+int main(int argc, char* argv[]) {
     Inventory inventory;
     int choice;
 
+    // Non-interactive modes
+    if (argc > 1 && string(argv[1]) == "--bench-restock") {
+        size_t itemCount = argc > 2 ? stoul(argv[2]) : 1000000;
+        size_t restockCount = argc > 3 ? stoul(argv[3]) : 1000000;
+        runRestockBenchmark(max<size_t>(itemCount, 1), restockCount);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-snapshot") {
+        size_t itemCount = argc > 2 ? stoul(argv[2]) : 1000000;
+        runSnapshotBenchmark(itemCount, argc > 3 ? argv[3] : "ims_bench.snap");
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-import") {
+        size_t itemCount = argc > 2 ? stoul(argv[2]) : 10000000;
+        unsigned threadCount = argc > 3 ? stoul(argv[3]) : 0;
+        runImportBenchmark(itemCount, threadCount, argc > 4 ? argv[4] : "ims_bench.csv");
+        return 0;
+    }
+
+    inventory.setLowStockListener([](const Item& item, bool low) {
+        if (low) {
+            cout << "[Low stock] \"" << item.name << "\" is down to " << item.quantity << " units." << endl;
+        } else {
+            cout << "[Restocked] \"" << item.name << "\" is back to " << item.quantity << " units." << endl;
+        }
+    });
+
     do {
         choice = displayMenu();
 
@@ -390,9 +1401,12 @@ int main() {
         }
         case 14: {
             string filename;
+            char merge;
             cout << "Enter filename to import inventory from CSV: ";
             cin >> filename;
-            inventory.importFromCSV(filename);
+            cout << "Update items that already exist? (y/n): ";
+            cin >> merge;
+            inventory.importFromCSV(filename, merge == 'y' || merge == 'Y');
             break;
         }
         case 15: {
@@ -409,7 +1423,7 @@ int main() {
             inventory.getLeastExpensiveItem();
             break;
         case 18:
-            inventory.sortItemsByPrice();
+            inventory.displayItemsByPrice();
             break;
         case 19: {
             double minPrice, maxPrice;
@@ -423,6 +1437,37 @@ int main() {
         case 20:
             cout << "Exiting..." << endl;
             break;
+        case 21: {
+            string name;
+            int quantity;
+            cout << "Enter item name to sell: ";
+            cin >> name;
+            cout << "Enter quantity to sell: ";
+            cin >> quantity;
+            inventory.sellItem(name, quantity);
+            break;
+        }
+        case 22: {
+            string name;
+            int reorderPoint;
+            cout << "Enter item name (* for the default of all items without their own): ";
+            cin >> name;
+            cout << "Enter reorder point (-1 to clear): ";
+            cin >> reorderPoint;
+            if (name == "*") {
+                size_t wentLow = inventory.setDefaultReorderPoint(reorderPoint);
+                cout << "Default reorder point set to " << reorderPoint << "; " << wentLow
+                     << " more items are below it, " << inventory.lowStockCount() << " on the watchlist." << endl;
+            } else if (inventory.setReorderPoint(name, reorderPoint)) {
+                cout << "Reorder point of \"" << name << "\" set to " << reorderPoint << "." << endl;
+            } else {
+                cout << "Item \"" << name << "\" not found." << endl;
+            }
+            break;
+        }
+        case 23:
+            inventory.displayLowStock();
+            break;
         default:
             cout << "Invalid choice. Please try again." << endl;
             break;